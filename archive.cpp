@@ -0,0 +1,339 @@
+#include <string>
+#include <vector>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <windows.h>
+
+#include "ec.hpp"
+#include "archive.hpp"
+
+static VOID putBitmap(char *buffer, const EC_MASK &bitmap)
+{
+    for (UINT16 i = 0; i < 32; i++)
+    {
+        BYTE bits = 0x00;
+        for (BYTE j = 0; j < 8; j++)
+            bits |= bitmap.test(i * 8 + j) << j;
+        buffer[i] = bits;
+    }
+}
+
+static VOID getBitmap(const char *buffer, EC_MASK &bitmap)
+{
+    for (UINT16 i = 0; i < 32; i++)
+        for (BYTE j = 0; j < 8; j++)
+            bitmap.set(i * 8 + j, (buffer[i] >> j) & 0x01);
+}
+
+static VOID putTimestamp(char *buffer, ULONGLONG timestamp)
+{
+    for (BYTE i = 0; i < 8; i++)
+        buffer[i] = (timestamp >> (i * 8)) & 0xFF;
+}
+
+static ULONGLONG getTimestamp(const char *buffer)
+{
+    ULONGLONG timestamp = 0;
+    for (BYTE i = 0; i < 8; i++)
+        timestamp |= (ULONGLONG)(BYTE)buffer[i] << (i * 8);
+    return timestamp;
+}
+
+SnapshotArchiveWriter::SnapshotArchiveWriter(std::string path, UINT16 keyframeInterval)
+{
+    this->keyframeInterval = keyframeInterval ? keyframeInterval : 1;
+
+    // Continuing an existing archive, next record will be a keyframe
+    std::vector<ARCHIVE_INDEX_ENTRY> entries;
+    std::vector<ARCHIVE_INDEX_ENTRY> missing;
+    std::ifstream existing(path, std::ios::in | std::ios::binary | std::ios::ate);
+    ULONGLONG size = existing ? (ULONGLONG)existing.tellg() : 0;
+    if (size > 0)
+    {
+        char header[ARCHIVE_RECORD_HEADER_SIZE];
+        existing.seekg(0);
+        existing.read(header, ARCHIVE_HEADER_SIZE);
+        if (existing.gcount() != ARCHIVE_HEADER_SIZE ||
+            std::memcmp(header, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) != 0 ||
+            header[4] != ARCHIVE_VERSION)
+            return;
+
+        std::ifstream existingIndex(path + ".idx", std::ios::in | std::ios::binary);
+        char entry[sizeof(ARCHIVE_INDEX_ENTRY)];
+        while (existingIndex.read(entry, sizeof(entry)))
+            entries.push_back({getTimestamp(entry), getTimestamp(entry + 8)});
+        existingIndex.close();
+        while (!entries.empty() && entries.back().offset + ARCHIVE_RECORD_HEADER_SIZE > size)
+            entries.pop_back();
+
+        // Walking records after the last indexed keyframe, or all of them without an index,
+        // up to the last complete one
+        ULONGLONG offset = entries.empty() ? ARCHIVE_HEADER_SIZE : entries.back().offset;
+        ULONGLONG end = offset;
+        while (end + ARCHIVE_RECORD_HEADER_SIZE <= size)
+        {
+            EC_MASK bitmap;
+            existing.seekg(end);
+            if (!existing.read(header, ARCHIVE_RECORD_HEADER_SIZE) || (BYTE)header[0] > ARCHIVE_DELTA)
+                break;
+            getBitmap(header + 9, bitmap);
+            if (end + ARCHIVE_RECORD_HEADER_SIZE + bitmap.count() > size)
+                break;
+
+            if (header[0] == ARCHIVE_KEYFRAME && (entries.empty() || end > entries.back().offset))
+                missing.push_back({getTimestamp(header + 1), end});
+            this->lastTimestamp = getTimestamp(header + 1);
+            end += ARCHIVE_RECORD_HEADER_SIZE + bitmap.count();
+        }
+        existing.close();
+
+        // Dropping the partial record left by an interrupted append and index entries pointing past it
+        while (!entries.empty() && entries.back().offset >= end)
+            entries.pop_back();
+        std::error_code error;
+        if (end < size)
+            std::filesystem::resize_file(path, end, error);
+        if (std::filesystem::exists(path + ".idx", error))
+            std::filesystem::resize_file(path + ".idx", entries.size() * sizeof(ARCHIVE_INDEX_ENTRY), error);
+        if (error)
+            return;
+    }
+    else
+        existing.close();
+
+    this->file.open(path, std::ios::out | std::ios::binary | std::ios::app);
+    this->index.open(path + ".idx", std::ios::out | std::ios::binary | std::ios::app);
+    if (this->file && this->index)
+    {
+        // Put position is unspecified until the first write in append mode
+        this->file.seekp(0, std::ios::end);
+        this->index.seekp(0, std::ios::end);
+        if (this->file.tellp() == 0)
+        {
+            char header[ARCHIVE_HEADER_SIZE] = {0};
+            std::memcpy(header, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+            header[4] = ARCHIVE_VERSION;
+            this->file.write(header, ARCHIVE_HEADER_SIZE);
+        }
+
+        for (const ARCHIVE_INDEX_ENTRY &item : missing)
+        {
+            char entry[sizeof(ARCHIVE_INDEX_ENTRY)];
+            putTimestamp(entry, item.timestamp);
+            putTimestamp(entry + 8, item.offset);
+            this->index.write(entry, sizeof(entry));
+        }
+        this->index.flush();
+        this->opened = TRUE;
+    }
+}
+
+BOOL SnapshotArchiveWriter::append(const EC_SNAPSHOT &snapshot)
+{
+    if (!this->opened || snapshot.timestamp < this->lastTimestamp)
+        return FALSE;
+
+    char record[ARCHIVE_RECORD_MAX_SIZE];
+    BYTE type = ARCHIVE_DELTA;
+    EC_MASK bitmap;
+
+    if (!this->hasPrevious ||
+        this->recordsSinceKeyframe >= this->keyframeInterval ||
+        this->previous.valid != snapshot.valid)
+    {
+        type = ARCHIVE_KEYFRAME;
+        bitmap = snapshot.valid;
+    }
+    else
+        for (UINT16 address = 0x00; address <= 0xFF; address++)
+            bitmap.set(address, snapshot.valid.test(address) &&
+                                    snapshot.data[address] != this->previous.data[address]);
+
+    record[0] = type;
+    putTimestamp(record + 1, snapshot.timestamp);
+    putBitmap(record + 9, bitmap);
+    UINT16 size = ARCHIVE_RECORD_HEADER_SIZE;
+    for (UINT16 address = 0x00; address <= 0xFF; address++)
+        if (bitmap.test(address))
+            record[size++] = snapshot.data[address];
+
+    ULONGLONG offset = this->file.tellp();
+    this->file.write(record, size);
+    this->file.flush();
+    if (!this->file)
+        return FALSE;
+
+    if (type == ARCHIVE_KEYFRAME)
+    {
+        char entry[sizeof(ARCHIVE_INDEX_ENTRY)];
+        putTimestamp(entry, snapshot.timestamp);
+        putTimestamp(entry + 8, offset);
+        this->index.write(entry, sizeof(entry));
+        this->index.flush();
+        this->recordsSinceKeyframe = 0;
+    }
+
+    this->recordsSinceKeyframe++;
+    this->previous = snapshot;
+    this->lastTimestamp = snapshot.timestamp;
+    this->hasPrevious = TRUE;
+    return TRUE;
+}
+
+VOID SnapshotArchiveWriter::close()
+{
+    this->file.close();
+    this->index.close();
+    this->opened = FALSE;
+}
+
+SnapshotArchiveReader::SnapshotArchiveReader(std::string path)
+{
+    this->file.open(path, std::ios::in | std::ios::binary);
+    if (!this->file)
+        return;
+
+    char header[ARCHIVE_HEADER_SIZE];
+    this->file.read(header, ARCHIVE_HEADER_SIZE);
+    if (this->file.gcount() != ARCHIVE_HEADER_SIZE ||
+        std::memcmp(header, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) != 0 ||
+        header[4] != ARCHIVE_VERSION)
+        return;
+
+    std::ifstream indexFile(path + ".idx", std::ios::in | std::ios::binary);
+    char entry[sizeof(ARCHIVE_INDEX_ENTRY)];
+    while (indexFile.read(entry, sizeof(entry)))
+        this->index.push_back({getTimestamp(entry), getTimestamp(entry + 8)});
+
+    // Rebuilding the time index from record headers when it's missing
+    if (this->index.empty())
+    {
+        BYTE type;
+        ULONGLONG timestamp;
+        EC_MASK bitmap;
+        ULONGLONG offset = this->file.tellg();
+        while (this->readHeader(type, timestamp, bitmap))
+        {
+            if (type == ARCHIVE_KEYFRAME)
+                this->index.push_back({timestamp, offset});
+            this->file.seekg(bitmap.count(), std::ios::cur);
+            offset = this->file.tellg();
+        }
+        this->file.clear();
+    }
+
+    this->opened = TRUE;
+}
+
+BOOL SnapshotArchiveReader::read(ULONGLONG timestamp, EC_SNAPSHOT &snapshot)
+{
+    if (!this->opened || !this->seek(timestamp))
+        return FALSE;
+
+    BYTE type;
+    ULONGLONG recordTimestamp;
+    EC_MASK bitmap;
+    char payload[256];
+    BOOL found = FALSE;
+
+    while (this->readHeader(type, recordTimestamp, bitmap) && recordTimestamp <= timestamp)
+    {
+        if (!this->file.read(payload, bitmap.count()))
+            break;
+
+        if (type == ARCHIVE_KEYFRAME)
+            snapshot.valid = bitmap;
+        UINT16 i = 0;
+        for (UINT16 address = 0x00; address <= 0xFF; address++)
+            if (bitmap.test(address))
+                snapshot.data[address] = payload[i++];
+        snapshot.timestamp = recordTimestamp;
+        found = TRUE;
+    }
+
+    this->file.clear();
+    return found;
+}
+
+std::vector<std::pair<ULONGLONG, BYTE>> SnapshotArchiveReader::history(BYTE bRegister, ULONGLONG from, ULONGLONG to)
+{
+    std::vector<std::pair<ULONGLONG, BYTE>> result;
+    if (!this->opened || this->index.empty())
+        return result;
+    if (!this->seek(from))
+    {
+        // Range starts before the first keyframe
+        this->file.clear();
+        this->file.seekg(this->index.front().offset);
+    }
+
+    BYTE type;
+    ULONGLONG timestamp;
+    EC_MASK bitmap;
+    EC_MASK below;
+    BYTE value = 0x00;
+    BOOL known = FALSE;
+    BOOL changed = FALSE;
+
+    while (this->readHeader(type, timestamp, bitmap) && timestamp <= to)
+    {
+        std::streamoff next = bitmap.count();
+        if (type == ARCHIVE_KEYFRAME && !bitmap.test(bRegister))
+            known = FALSE;
+        else if (bitmap.test(bRegister))
+        {
+            // Position of register's value is the number of preceding set bits
+            below = bitmap << (0xFF - bRegister);
+            std::streamoff position = below.count() - 1;
+            char byte;
+            this->file.seekg(position, std::ios::cur);
+            if (!this->file.get(byte))
+                break;
+            next -= position + 1;
+            changed = !known || value != (BYTE)byte;
+            value = byte;
+            known = TRUE;
+        }
+        this->file.seekg(next, std::ios::cur);
+
+        if (known && timestamp >= from && (changed || result.empty()))
+            result.push_back(std::pair<ULONGLONG, BYTE>(timestamp, value));
+        changed = FALSE;
+    }
+
+    this->file.clear();
+    return result;
+}
+
+VOID SnapshotArchiveReader::close()
+{
+    this->file.close();
+    this->opened = FALSE;
+}
+
+BOOL SnapshotArchiveReader::readHeader(BYTE &type, ULONGLONG &timestamp, EC_MASK &bitmap)
+{
+    char header[ARCHIVE_RECORD_HEADER_SIZE];
+    if (!this->file.read(header, ARCHIVE_RECORD_HEADER_SIZE))
+        return FALSE;
+
+    type = header[0];
+    timestamp = getTimestamp(header + 1);
+    getBitmap(header + 9, bitmap);
+    return TRUE;
+}
+
+BOOL SnapshotArchiveReader::seek(ULONGLONG timestamp)
+{
+    auto entry = std::upper_bound(
+        this->index.begin(), this->index.end(), timestamp,
+        [](ULONGLONG value, const ARCHIVE_INDEX_ENTRY &item) { return value < item.timestamp; });
+    if (entry == this->index.begin())
+        return FALSE;
+
+    this->file.clear();
+    this->file.seekg((--entry)->offset);
+    return TRUE;
+}
@@ -0,0 +1,118 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include "string"
+#include "vector"
+#include "fstream"
+
+#include "ec.hpp"
+
+constexpr char ARCHIVE_MAGIC[4] = {'E', 'C', 'A', 'R'};
+constexpr BYTE ARCHIVE_VERSION = 1;
+constexpr BYTE ARCHIVE_HEADER_SIZE = 8;           // Magic, version and 3 reserved bytes
+constexpr BYTE ARCHIVE_RECORD_HEADER_SIZE = 41;   // Record type, timestamp and bitmap
+constexpr UINT16 ARCHIVE_RECORD_MAX_SIZE = 297;   // Record header and all registers
+
+constexpr BYTE ARCHIVE_KEYFRAME = 0; // Bitmap of valid registers followed by their value
+constexpr BYTE ARCHIVE_DELTA = 1;    // Bitmap of changed registers followed by their new value
+
+/** Entry of the time index, pointing to a keyframe */
+struct ARCHIVE_INDEX_ENTRY
+{
+    ULONGLONG timestamp; // Capture time of keyframe in milliseconds since Unix epoch
+    ULONGLONG offset;    // Position of keyframe in the archive file
+};
+
+/**
+ * Append-only writer of delta compressed snapshot archives.
+ * Each record stores a bitmap of changed registers and their value against the previous snapshot,
+ * a full keyframe is stored periodically and whenever the set of valid registers changes.
+ * Keyframes are listed in a time index beside the archive with `.idx` suffix.
+ */
+class SnapshotArchiveWriter
+{
+public:
+    BOOL opened = FALSE;
+
+    /**
+     * @param path Path of archive file, appended to if it already exists. An incomplete trailing record
+     * left by an interrupted append is truncated and missing time index entries are rebuilt.
+     * @param keyframeInterval Number of records between two keyframes.
+     */
+    SnapshotArchiveWriter(std::string path = "dump.ecar", UINT16 keyframeInterval = 64);
+
+    /**
+     * Append snapshot to the archive.
+     * @param snapshot Snapshot to be stored, timestamps must not decrease.
+     * @return Successfulness of operation.
+     */
+    BOOL append(const EC_SNAPSHOT &snapshot);
+
+    /** Close the archive files */
+    VOID close();
+
+protected:
+    std::ofstream file;
+    std::ofstream index;
+    EC_SNAPSHOT previous;
+    UINT16 keyframeInterval;
+    UINT16 recordsSinceKeyframe = 0;
+    ULONGLONG lastTimestamp = 0;
+    BOOL hasPrevious = FALSE;
+};
+
+/**
+ * Random access reader of delta compressed snapshot archives.
+ * Snapshots are reconstructed from the nearest preceding keyframe found in the time index.
+ */
+class SnapshotArchiveReader
+{
+public:
+    BOOL opened = FALSE;
+    std::vector<ARCHIVE_INDEX_ENTRY> index;
+
+    /** @param path Path of archive file. */
+    SnapshotArchiveReader(std::string path = "dump.ecar");
+
+    /**
+     * Reconstruct the latest snapshot captured at or before the given time.
+     * @param timestamp Time in milliseconds since Unix epoch.
+     * @param snapshot Snapshot to be filled.
+     * @return Whether such snapshot exists.
+     */
+    BOOL read(ULONGLONG timestamp, EC_SNAPSHOT &snapshot);
+
+    /**
+     * Collect changes of a register within the given time range.
+     * Only record headers are read, payloads are skipped except for the requested register.
+     * @param bRegister Address of register.
+     * @param from Start of range in milliseconds since Unix epoch.
+     * @param to End of range in milliseconds since Unix epoch.
+     * @return Pairs of timestamp and value, starting with the first known value in range.
+     */
+    std::vector<std::pair<ULONGLONG, BYTE>> history(BYTE bRegister, ULONGLONG from = 0, ULONGLONG to = ~0ULL);
+
+    /** Close the archive file */
+    VOID close();
+
+protected:
+    std::ifstream file;
+
+    /**
+     * Read header of the record at current position.
+     * @param type Type of record.
+     * @param timestamp Capture time of record.
+     * @param bitmap Bitmap of record.
+     * @return Whether a complete header was read.
+     */
+    BOOL readHeader(BYTE &type, ULONGLONG &timestamp, EC_MASK &bitmap);
+
+    /**
+     * Position the file on the keyframe preceding the given time.
+     * @param timestamp Time in milliseconds since Unix epoch.
+     * @return Whether such keyframe exists.
+     */
+    BOOL seek(ULONGLONG timestamp);
+};
+
+#endif
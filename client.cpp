@@ -0,0 +1,188 @@
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <windows.h>
+
+#include "ec.hpp"
+#include "ipc.hpp"
+#include "client.hpp"
+
+size_t ECBatch::add(BYTE opcode, BYTE bRegister, DWORD value, DWORD mask)
+{
+    this->operations.push_back({opcode, bRegister, mask, value});
+    return this->operations.size() - 1;
+}
+
+VOID ECBatch::clear()
+{
+    this->operations.clear();
+    this->results.clear();
+    this->snapshots.clear();
+}
+
+ECClient::ECClient(std::string pipeName, UINT16 timeout)
+{
+    this->pipe = CreateFileA(pipeName.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+    if (this->pipe == INVALID_HANDLE_VALUE &&
+        GetLastError() == ERROR_PIPE_BUSY &&
+        WaitNamedPipeA(pipeName.c_str(), timeout))
+        this->pipe = CreateFileA(pipeName.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+    if (this->pipe == INVALID_HANDLE_VALUE)
+        return;
+
+    DWORD mode = PIPE_READMODE_MESSAGE;
+    if (SetNamedPipeHandleState(this->pipe, &mode, NULL, NULL))
+        this->connected = TRUE;
+    else
+        this->close();
+}
+
+VOID ECClient::close()
+{
+    if (this->pipe != INVALID_HANDLE_VALUE)
+        CloseHandle(this->pipe);
+    this->pipe = INVALID_HANDLE_VALUE;
+    this->connected = FALSE;
+}
+
+BOOL ECClient::execute(ECBatch &batch)
+{
+    batch.results.clear();
+    batch.snapshots.clear();
+
+    size_t count = batch.operations.size();
+    size_t dumps = std::count_if(
+        batch.operations.begin(), batch.operations.end(),
+        [](const IPC_OPERATION &operation) { return operation.opcode == IPC_DUMP; });
+    if (!this->connected ||
+        IPC_REQUEST_HEADER_SIZE + count * IPC_OPERATION_SIZE > IPC_BUFFER_SIZE ||
+        IPC_RESPONSE_HEADER_SIZE + count * IPC_RESULT_SIZE + dumps * IPC_SNAPSHOT_SIZE > IPC_BUFFER_SIZE)
+        return FALSE;
+
+    std::vector<BYTE> request(IPC_REQUEST_HEADER_SIZE + count * IPC_OPERATION_SIZE);
+    std::vector<BYTE> response(IPC_BUFFER_SIZE);
+    putValue(request.data(), count, 2);
+    request[2] = batch.priority;
+    for (size_t i = 0; i < count; i++)
+    {
+        BYTE *cursor = request.data() + IPC_REQUEST_HEADER_SIZE + i * IPC_OPERATION_SIZE;
+        cursor[0] = batch.operations[i].opcode;
+        cursor[1] = batch.operations[i].bRegister;
+        putValue(cursor + 2, batch.operations[i].mask, 4);
+        putValue(cursor + 6, batch.operations[i].value, 4);
+    }
+
+    DWORD size = 0;
+    if (!TransactNamedPipe(this->pipe, request.data(), request.size(), response.data(), IPC_BUFFER_SIZE, &size, NULL))
+    {
+        this->close();
+        return FALSE;
+    }
+    if (size < IPC_RESPONSE_HEADER_SIZE || getValue(response.data(), 2) != count)
+        return FALSE;
+
+    const BYTE *cursor = response.data() + IPC_RESPONSE_HEADER_SIZE;
+    for (size_t i = 0; i < count; i++)
+    {
+        BOOL isDump = batch.operations[i].opcode == IPC_DUMP;
+        if (cursor + IPC_RESULT_SIZE + (isDump ? IPC_SNAPSHOT_SIZE : 0) > response.data() + size)
+            return FALSE;
+
+        batch.results.push_back({cursor[0], getValue(cursor + 1, 4)});
+        cursor += IPC_RESULT_SIZE;
+        if (isDump)
+        {
+            EC_SNAPSHOT snapshot;
+            snapshot.timestamp = getValue(cursor, 4) | ((ULONGLONG)getValue(cursor + 4, 4) << 32);
+            for (UINT16 address = 0x00; address <= 0xFF; address++)
+                snapshot.valid.set(address, (cursor[8 + address / 8] >> (address % 8)) & 0x01);
+            std::copy(cursor + 40, cursor + IPC_SNAPSHOT_SIZE, snapshot.data.begin());
+            batch.snapshots.push_back(snapshot);
+            cursor += IPC_SNAPSHOT_SIZE;
+        }
+    }
+
+    return TRUE;
+}
+
+EC_DUMP ECClient::dump()
+{
+    EC_SNAPSHOT snapshot;
+    this->dump(snapshot);
+    return snapshot.toMap();
+}
+
+BOOL ECClient::dump(EC_SNAPSHOT &snapshot)
+{
+    ECBatch batch;
+    batch.add(IPC_DUMP);
+    if (!this->execute(batch))
+        return FALSE;
+
+    snapshot = batch.snapshots.front();
+    return batch.results.front().status == IPC_OK;
+}
+
+BYTE ECClient::readByte(BYTE bRegister)
+{
+    return this->single(IPC_READ_BYTE, bRegister).value;
+}
+
+WORD ECClient::readWord(BYTE bRegister)
+{
+    return this->single(IPC_READ_WORD, bRegister).value;
+}
+
+DWORD ECClient::readDword(BYTE bRegister)
+{
+    return this->single(IPC_READ_DWORD, bRegister).value;
+}
+
+BOOL ECClient::writeByte(BYTE bRegister, BYTE value)
+{
+    return this->single(IPC_WRITE_BYTE, bRegister, value).status == IPC_OK;
+}
+
+BOOL ECClient::writeWord(BYTE bRegister, WORD value)
+{
+    return this->single(IPC_WRITE_WORD, bRegister, value).status == IPC_OK;
+}
+
+BOOL ECClient::writeDword(BYTE bRegister, DWORD value)
+{
+    return this->single(IPC_WRITE_DWORD, bRegister, value).status == IPC_OK;
+}
+
+BOOL ECClient::updateBits(BYTE bRegister, BYTE mask, BYTE value, BYTE *old)
+{
+    IPC_RESULT result = this->single(IPC_UPDATE_BYTE, bRegister, value, mask);
+    if (old != NULL)
+        *old = (BYTE)result.value;
+    return result.status == IPC_OK;
+}
+
+BOOL ECClient::updateWordBits(BYTE bRegister, WORD mask, WORD value, WORD *old)
+{
+    IPC_RESULT result = this->single(IPC_UPDATE_WORD, bRegister, value, mask);
+    if (old != NULL)
+        *old = (WORD)result.value;
+    return result.status == IPC_OK;
+}
+
+BOOL ECClient::updateDwordBits(BYTE bRegister, DWORD mask, DWORD value, DWORD *old)
+{
+    IPC_RESULT result = this->single(IPC_UPDATE_DWORD, bRegister, value, mask);
+    if (old != NULL)
+        *old = (DWORD)result.value;
+    return result.status == IPC_OK;
+}
+
+IPC_RESULT ECClient::single(BYTE opcode, BYTE bRegister, DWORD value, DWORD mask)
+{
+    ECBatch batch;
+    batch.priority = this->priority;
+    batch.add(opcode, bRegister, value, mask);
+    if (!this->execute(batch))
+        return {IPC_FAILED, 0x00};
+    return batch.results.front();
+}
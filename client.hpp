@@ -0,0 +1,161 @@
+#ifndef CLIENT_H
+#define CLIENT_H
+
+#include "string"
+#include "vector"
+
+#include "ec.hpp"
+#include "ipc.hpp"
+
+/** Batch of operations sent to `ECHelper` in a single message */
+class ECBatch
+{
+public:
+    std::vector<IPC_OPERATION> operations;
+    std::vector<IPC_RESULT> results;     // Result of operations, filled by `ECClient::execute()`
+    std::vector<EC_SNAPSHOT> snapshots;  // Result of dump operations in order of appearance
+    BYTE priority = EC_INTERACTIVE;      // Priority class of the operations, dumps always run as `EC_BULK`
+
+    /**
+     * Append an operation to the batch.
+     * @param opcode Type of operation.
+     * @param bRegister Address of register.
+     * @param value Value of register for write and update operations.
+     * @param mask Bits to be modified for update operations.
+     * @return Index of operation's result.
+     */
+    size_t add(BYTE opcode, BYTE bRegister = 0x00, DWORD value = 0x00, DWORD mask = 0x00);
+
+    /** Remove all operations and results */
+    VOID clear();
+};
+
+/**
+ * Unprivileged process side of the EC access, forwarding operations to `ECHelper`.
+ * Each call costs one round trip, use `execute()` to batch several operations.
+ */
+class ECClient
+{
+public:
+    BOOL connected = FALSE;
+    BYTE priority = EC_INTERACTIVE; // Priority class of single operations
+
+    /**
+     * @param pipeName Name of the pipe `ECHelper` listens on.
+     * @param timeout Waiting threshold in milliseconds when the helper is busy.
+     */
+    ECClient(std::string pipeName = IPC_PIPE_NAME, UINT16 timeout = 1000);
+
+    /** Close the connection */
+    VOID close();
+
+    /**
+     * Execute a batch of operations in a single round trip.
+     * @param batch Batch to be executed, its results are filled in place.
+     * @return Whether the helper answered the batch.
+     */
+    BOOL execute(ECBatch &batch);
+
+    /**
+     * Generate a dump of all registers.
+     * @return Map of register's address and value.
+     */
+    EC_DUMP dump();
+
+    /**
+     * Generate a dump of all registers into the given snapshot.
+     * @param snapshot Snapshot to be filled.
+     * @return Whether all registers were read successfully.
+     */
+    BOOL dump(EC_SNAPSHOT &snapshot);
+
+    /**
+     * Read EC register as BYTE.
+     * @param bRegister Address of register.
+     * @return Value of register.
+     */
+    BYTE readByte(BYTE bRegister);
+
+    /**
+     * Read EC register as WORD.
+     * @param bRegister Address of register.
+     * @return Value of register.
+     */
+    WORD readWord(BYTE bRegister);
+
+    /**
+     * Read EC register as DWORD.
+     * @param bRegister Address of register.
+     * @return Value of register.
+     */
+    DWORD readDword(BYTE bRegister);
+
+    /**
+     * Write EC register as BYTE.
+     * @param bRegister Address of register.
+     * @param value Value of register.
+     * @return Successfulness of operation.
+     */
+    BOOL writeByte(BYTE bRegister, BYTE value);
+
+    /**
+     * Write EC register as WORD.
+     * @param bRegister Address of register.
+     * @param value Value of register.
+     * @return Successfulness of operation.
+     */
+    BOOL writeWord(BYTE bRegister, WORD value);
+
+    /**
+     * Write EC register as DWORD.
+     * @param bRegister Address of register.
+     * @param value Value of register.
+     * @return Successfulness of operation.
+     */
+    BOOL writeDword(BYTE bRegister, DWORD value);
+
+    /**
+     * Atomically update bits of EC register as BYTE.
+     * @param bRegister Address of register.
+     * @param mask Bits to be modified.
+     * @param value New value of masked bits.
+     * @param old Value of register before the update, filled whenever it could be read.
+     * @return Successfulness of operation, registers are left untouched on failure.
+     */
+    BOOL updateBits(BYTE bRegister, BYTE mask, BYTE value, BYTE *old = NULL);
+
+    /**
+     * Atomically update bits of EC register as WORD.
+     * @param bRegister Address of register.
+     * @param mask Bits to be modified.
+     * @param value New value of masked bits.
+     * @param old Value of register before the update, filled whenever it could be read.
+     * @return Successfulness of operation, registers are left untouched on failure.
+     */
+    BOOL updateWordBits(BYTE bRegister, WORD mask, WORD value, WORD *old = NULL);
+
+    /**
+     * Atomically update bits of EC register as DWORD.
+     * @param bRegister Address of register.
+     * @param mask Bits to be modified.
+     * @param value New value of masked bits.
+     * @param old Value of register before the update, filled whenever it could be read.
+     * @return Successfulness of operation, registers are left untouched on failure.
+     */
+    BOOL updateDwordBits(BYTE bRegister, DWORD mask, DWORD value, DWORD *old = NULL);
+
+protected:
+    HANDLE pipe = INVALID_HANDLE_VALUE;
+
+    /**
+     * Execute a single operation.
+     * @param opcode Type of operation.
+     * @param bRegister Address of register.
+     * @param value Value of register.
+     * @param mask Bits to be modified.
+     * @return Result of operation.
+     */
+    IPC_RESULT single(BYTE opcode, BYTE bRegister, DWORD value = 0x00, DWORD mask = 0x00);
+};
+
+#endif
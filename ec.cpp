@@ -1,13 +1,20 @@
 #include <map>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
 #include <fstream>
-#include <sstream>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 #include <windows.h>
 
 #include "ec.hpp"
 #include "driver.hpp"
 
+static thread_local BYTE threadPriority = EC_INTERACTIVE;
+
 EmbeddedController::EmbeddedController(
     BYTE scPort,
     BYTE dataPort,
@@ -34,72 +41,266 @@ VOID EmbeddedController::close()
     this->driverLoaded = FALSE;
 }
 
-EC_DUMP EmbeddedController::dump()
+EC_SNAPSHOT::EC_SNAPSHOT(const EC_DUMP &dump)
+{
+    for (auto const &[address, value] : dump)
+    {
+        this->data[address] = value;
+        this->valid.set(address);
+    }
+}
+
+EC_DUMP EC_SNAPSHOT::toMap() const
 {
     EC_DUMP _dump;
-    for (UINT16 column = 0x00; column <= 0xF0; column += 0x10)
-        for (UINT16 row = 0x00; row <= 0x0F; row++)
-        {
-            UINT16 address = column + row;
-            _dump.insert(std::pair<BYTE, BYTE>(address, this->readByte(address)));
-        }
+    for (UINT16 address = 0x00; address <= 0xFF; address++)
+        _dump.insert(std::pair<BYTE, BYTE>(address, this->valid.test(address) ? this->data[address] : 0x00));
 
     return _dump;
 }
 
-VOID EmbeddedController::printDump()
+EC_DUMP EmbeddedController::dump()
 {
-    std::stringstream stream;
-    stream << std::hex << std::uppercase << std::setfill('0')
-           << " # | 00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F" << std::endl
-           << "---|------------------------------------------------" << std::endl
-           << "00 | ";
+    EC_SNAPSHOT snapshot;
+    this->dump(snapshot);
+    return snapshot.toMap();
+}
 
-    for (auto const &[address, value] : this->dump())
+BOOL EmbeddedController::dump(EC_SNAPSHOT &snapshot)
+{
+    return this->dump(snapshot, NULL);
+}
+
+BOOL EmbeddedController::dump(EC_SNAPSHOT &snapshot, BOOL *preempted)
+{
+    BOOL yielded = FALSE;
+    Lock lock(this, EC_BULK);
+    snapshot.timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
+                             std::chrono::system_clock::now().time_since_epoch())
+                             .count();
+
+    for (UINT16 address = 0x00; address <= 0xFF; address++)
     {
-        UINT16 nextAddress = address + 0x01;
-        stream << std::setw(2) << (UINT16)value << " ";
-        if (nextAddress % 0x10 == 0x00) // End of row
-            stream << std::endl
-                   << nextAddress << " | ";
+        snapshot.valid.set(address, this->operation(READ, address, &snapshot.data[address]));
+        yielded |= this->yield();
     }
 
-    std::string result = stream.str();
+    if (preempted != NULL)
+        *preempted = yielded;
+    return snapshot.valid.all();
+}
+
+VOID EmbeddedController::printDump()
+{
+    EC_SNAPSHOT snapshot;
+    this->dump(snapshot);
+    this->printDump(snapshot);
+}
+
+VOID EmbeddedController::printDump(const EC_SNAPSHOT &snapshot)
+{
+    // Each row is "XX | " followed by 16 "XX " cells and the line break
+    char row[5 + 16 * 3 + 1];
     std::cout << std::endl
-              << result.substr(0, result.size() - 7) // Removing last 7 characters
-              << std::endl;
+              << " # | 00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F" << std::endl
+              << "---|------------------------------------------------" << std::endl;
+
+    for (UINT16 column = 0x00; column <= 0xF0; column += 0x10)
+    {
+        char *cursor = row + std::snprintf(row, sizeof(row), "%02X | ", column);
+        for (UINT16 address = column; address <= column + 0x0F; address++)
+            if (snapshot.valid.test(address))
+                cursor += std::snprintf(cursor, 4, "%02X ", snapshot.data[address]);
+            else
+                cursor += std::snprintf(cursor, 4, "-- "); // Register couldn't be read
+
+        *cursor = '\n';
+        std::cout.write(row, sizeof(row));
+    }
+
+    std::cout << std::flush;
 }
 
 VOID EmbeddedController::saveDump(std::string output)
+{
+    EC_SNAPSHOT snapshot;
+    this->dump(snapshot);
+    this->saveDump(snapshot, output);
+}
+
+VOID EmbeddedController::saveDump(const EC_SNAPSHOT &snapshot, std::string output)
 {
     std::ofstream file(output, std::ios::out | std::ios::binary);
     if (file)
     {
-        for (auto const &[address, value] : this->dump())
-            file << this->readByte(address);
+        char bitmap[32] = {0};
+        for (UINT16 address = 0x00; address <= 0xFF; address++)
+        {
+            file.put(snapshot.valid.test(address) ? snapshot.data[address] : 0x00);
+            bitmap[address / 8] |= snapshot.valid.test(address) << (address % 8);
+        }
+
+        // Trailing bitmap of valid registers, only when some couldn't be read to keep the older format
+        if (!snapshot.valid.all())
+            file.write(bitmap, sizeof(bitmap));
+        file.close();
+    }
+}
+
+EC_SNAPSHOT EmbeddedController::loadDump(std::string input)
+{
+    EC_SNAPSHOT snapshot;
+    std::ifstream file(input, std::ios::in | std::ios::binary);
+    if (file)
+    {
+        file.read(reinterpret_cast<char *>(snapshot.data.data()), snapshot.data.size());
+        for (std::streamsize address = 0; address < file.gcount(); address++)
+            snapshot.valid.set(address);
+
+        char bitmap[32];
+        file.read(bitmap, sizeof(bitmap));
+        if (file.gcount() == sizeof(bitmap))
+            for (UINT16 address = 0x00; address <= 0xFF; address++)
+                snapshot.valid.set(address, snapshot.valid.test(address) && ((bitmap[address / 8] >> (address % 8)) & 0x01));
         file.close();
     }
+
+    return snapshot;
+}
+
+std::vector<BYTE> EmbeddedController::restoreDump(const EC_DUMP &snapshot, EC_MASK mask, BOOL dryRun)
+{
+    return this->restoreDump(EC_SNAPSHOT(snapshot), mask, dryRun);
+}
+
+std::vector<BYTE> EmbeddedController::restoreDump(const EC_SNAPSHOT &snapshot, EC_MASK mask, BOOL dryRun)
+{
+    std::vector<BYTE> failed;
+    std::vector<BYTE> writes;
+    EC_SNAPSHOT current;
+    Lock lock(this, EC_BULK);
+
+    // Computing the minimal set of writes against the current state
+    BOOL stale = FALSE;
+    this->dump(current, &stale);
+    mask &= snapshot.valid;
+    for (UINT16 address = 0x00; address <= 0xFF; address++)
+        if (mask.test(address) &&
+            (!current.valid.test(address) || current.data[address] != snapshot.data[address]))
+            writes.push_back(address);
+
+    if (dryRun)
+    {
+        std::cout << std::hex << std::uppercase << std::setfill('0');
+        for (BYTE address : writes)
+        {
+            std::cout << std::setw(2) << (UINT16)address << " | ";
+            if (current.valid.test(address))
+                std::cout << std::setw(2) << (UINT16)current.data[address];
+            else
+                std::cout << "--"; // Register couldn't be read
+            std::cout << " -> " << std::setw(2) << (UINT16)snapshot.data[address] << std::endl;
+        }
+        std::cout << std::dec << std::nouppercase << std::setfill(' ');
+        return failed;
+    }
+
+    for (BYTE address : writes)
+    {
+        // Registers written by preempting requests keep their new value, reported as failed
+        BYTE value = 0x00;
+        if (stale && current.valid.test(address) &&
+            (!this->operation(READ, address, &value) || value != current.data[address]))
+            continue;
+
+        this->writeByte(address, snapshot.data[address]);
+        stale |= this->yield();
+    }
+
+    // Verifying registers which didn't stick, e.g. read-only or volatile ones
+    for (BYTE address : writes)
+    {
+        BYTE result = 0x00;
+        if (!this->operation(READ, address, &result) || result != snapshot.data[address])
+            failed.push_back(address);
+        this->yield();
+    }
+
+    return failed;
+}
+
+BOOL EmbeddedController::loadProfile(std::string input)
+{
+    std::ifstream file(input, std::ios::in);
+    if (!file)
+        return FALSE;
+
+    EC_PROFILE _profile;
+    std::string line;
+    std::getline(file, line); // Skipping the header
+    while (std::getline(file, line))
+    {
+        UINT address, activeMask;
+        char type[16];
+        EC_REGISTER_PROFILE entry;
+        if (std::sscanf(line.c_str(), "%i,%15[^,],%lf,%i,%u,%u",
+                        &address, type, &entry.changeRate, &activeMask,
+                        &entry.pollInterval, &entry.cacheLifetime) != 6 ||
+            address > 0xFF)
+            return FALSE;
+
+        auto found = std::find(std::begin(EC_REGISTER_CLASSES), std::end(EC_REGISTER_CLASSES), std::string(type));
+        if (found == std::end(EC_REGISTER_CLASSES))
+            return FALSE;
+
+        entry.type = found - std::begin(EC_REGISTER_CLASSES);
+        entry.activeMask = activeMask;
+        _profile[address] = entry;
+    }
+
+    Lock lock(this, threadPriority);
+    this->profile = _profile;
+    this->cached.reset();
+    return TRUE;
 }
 
 BYTE EmbeddedController::readByte(BYTE bRegister)
 {
     BYTE result = 0x00;
-    this->operation(READ, bRegister, &result);
+    Lock lock(this, threadPriority);
+    UINT32 lifetime = this->profile[bRegister].cacheLifetime;
+    if (lifetime == 0)
+    {
+        this->operation(READ, bRegister, &result);
+        return result;
+    }
+
+    ULONGLONG now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now().time_since_epoch())
+                        .count();
+    if (this->cached.test(bRegister) && now - this->cachedAt[bRegister] < lifetime)
+        return this->cache[bRegister];
+
+    if (this->operation(READ, bRegister, &result))
+    {
+        this->cache[bRegister] = result;
+        this->cachedAt[bRegister] = now;
+        this->cached.set(bRegister);
+    }
+
     return result;
 }
 
 WORD EmbeddedController::readWord(BYTE bRegister)
 {
-    BYTE firstByte = 0x00;
-    BYTE secondByte = 0x00;
+    BYTE bytes[2] = {0x00};
     WORD result = 0x00;
 
-    if (this->operation(READ, bRegister, &firstByte) &&
-        this->operation(READ, bRegister + 0x01, &secondByte))
+    if (this->read(bRegister, bytes, 2, 2))
     {
         if (endianness == BIG_ENDIAN)
-            std::swap(firstByte, secondByte);
-        result = firstByte | (secondByte << 8);
+            std::swap(bytes[0], bytes[1]);
+        result = bytes[0] | (bytes[1] << 8);
     }
 
     return result;
@@ -107,31 +308,32 @@ WORD EmbeddedController::readWord(BYTE bRegister)
 
 DWORD EmbeddedController::readDword(BYTE bRegister)
 {
-    BYTE firstByte = 0x00;
-    BYTE secondByte = 0x00;
-    BYTE thirdByte = 0x00;
-    BYTE fourthByte = 0x00;
+    BYTE bytes[4] = {0x00};
     DWORD result = 0x00;
 
-    if (this->operation(READ, bRegister, &firstByte) &&
-        this->operation(READ, bRegister + 0x01, &secondByte) &&
-        this->operation(READ, bRegister + 0x02, &thirdByte) &&
-        this->operation(READ, bRegister + 0x03, &fourthByte))
+    if (this->read(bRegister, bytes, 4, 4))
     {
         if (endianness == BIG_ENDIAN)
         {
-            std::swap(firstByte, fourthByte);
-            std::swap(secondByte, thirdByte);
+            std::swap(bytes[0], bytes[3]);
+            std::swap(bytes[1], bytes[2]);
         }
-        result = firstByte |
-                 (secondByte << 8) |
-                 (thirdByte << 16) |
-                 (fourthByte << 24);
+        result = bytes[0] |
+                 (bytes[1] << 8) |
+                 (bytes[2] << 16) |
+                 ((DWORD)bytes[3] << 24);
     }
 
     return result;
 }
 
+BOOL EmbeddedController::readBuffer(BYTE bRegister, BYTE *buffer, UINT16 length, UINT16 stride)
+{
+    if (bRegister + length > 0x100)
+        return FALSE;
+    return this->read(bRegister, buffer, length, stride);
+}
+
 BOOL EmbeddedController::writeByte(BYTE bRegister, BYTE value)
 {
     return this->operation(WRITE, bRegister, &value);
@@ -172,10 +374,191 @@ BOOL EmbeddedController::writeDword(BYTE bRegister, DWORD value)
     return FALSE;
 }
 
+BOOL EmbeddedController::updateBits(BYTE bRegister, BYTE mask, BYTE value, BYTE *old)
+{
+    DWORD result = 0x00;
+    BOOL success = this->update(bRegister, 1, mask, value, &result);
+    if (old != NULL)
+        *old = (BYTE)result;
+    return success;
+}
+
+BOOL EmbeddedController::updateWordBits(BYTE bRegister, WORD mask, WORD value, WORD *old)
+{
+    DWORD result = 0x00;
+    BOOL success = this->update(bRegister, 2, mask, value, &result);
+    if (old != NULL)
+        *old = (WORD)result;
+    return success;
+}
+
+BOOL EmbeddedController::updateDwordBits(BYTE bRegister, DWORD mask, DWORD value, DWORD *old)
+{
+    return this->update(bRegister, 4, mask, value, old);
+}
+
+BOOL EmbeddedController::read(BYTE bRegister, BYTE *bytes, UINT16 length, UINT16 stride)
+{
+    if (stride == 0 || length % stride != 0)
+        return FALSE;
+
+    Lock lock(this, threadPriority);
+    auto pass = [&](UINT16 start, BYTE *buffer) {
+        // Reading the most significant byte first, some ECs latch the rest of value on it
+        BOOL reverse = this->highByteFirst.test((BYTE)(bRegister + start)) && endianness == LITTLE_ENDIAN;
+        for (UINT16 i = 0; i < stride; i++)
+        {
+            UINT16 offset = start + (reverse ? stride - 1 - i : i);
+            if (!this->operation(READ, bRegister + offset, &buffer[offset]))
+                return FALSE;
+        }
+        return TRUE;
+    };
+
+    BYTE check[0x100];
+    for (UINT16 start = 0; start < length; start += stride)
+    {
+        // Letting higher priority requests in between values of a large sweep
+        if (start > 0)
+            this->yield();
+
+        if (!this->consistentRead || stride <= 1)
+        {
+            if (!pass(start, bytes))
+                return FALSE;
+            continue;
+        }
+
+        // EC doesn't update its RAM while serving the host in burst mode,
+        // the window covers a single value to keep other requests waiting shortly
+        this->stats.consistentReads++;
+        if (this->burst(TRUE))
+        {
+            BOOL success = pass(start, bytes) && this->inBurst();
+            this->burst(FALSE);
+            if (success)
+            {
+                this->stats.burstReads++;
+                continue;
+            }
+        }
+
+        // Each value settles on its own, a changing neighbour doesn't make it unstable
+        if (!pass(start, bytes))
+            return FALSE;
+
+        BOOL stable = FALSE;
+        for (UINT16 i = 0; i < this->retry && !stable; i++)
+        {
+            if (!pass(start, check))
+                return FALSE;
+            stable = std::equal(bytes + start, bytes + start + stride, check + start);
+            if (!stable)
+            {
+                this->stats.tornReads++;
+                std::copy(check + start, check + start + stride, bytes + start);
+            }
+        }
+
+        if (!stable)
+        {
+            this->stats.unstableReads++;
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+BOOL EmbeddedController::update(BYTE bRegister, BYTE size, DWORD mask, DWORD value, DWORD *old)
+{
+    BYTE bytes[4] = {0x00};
+    BYTE values[4] = {0x00};
+    DWORD result = 0x00;
+    Lock lock(this, threadPriority);
+    BOOL bursting = this->burst(TRUE);
+
+    BOOL success = TRUE;
+    for (BYTE i = 0; i < size && success; i++)
+        success = this->operation(READ, bRegister + i, &bytes[i]);
+
+    // Burst window was lost while reading, taking the latest value right before writing
+    if (success && bursting && !this->inBurst())
+        for (BYTE i = 0; i < size && success; i++)
+            success = this->operation(READ, bRegister + i, &bytes[i]);
+
+    if (success)
+    {
+        for (BYTE i = 0; i < size; i++)
+        {
+            BYTE shift = (endianness == BIG_ENDIAN ? size - 1 - i : i) * 8;
+            BYTE byteMask = (mask >> shift) & 0xFF;
+            values[i] = (bytes[i] & ~byteMask) | ((value >> shift) & byteMask);
+            result |= (DWORD)bytes[i] << shift;
+        }
+        if (old != NULL)
+            *old = result;
+
+        // Skipping registers which their masked bits already hold the requested value
+        BYTE written = 0;
+        for (; written < size && success; written++)
+            if (values[written] != bytes[written])
+                success = this->operation(WRITE, bRegister + written, &values[written]);
+
+        // Rolling back registers written before the failed one
+        if (!success)
+            for (BYTE i = 0; i + 1 < written; i++)
+                if (values[i] != bytes[i])
+                    this->operation(WRITE, bRegister + i, &bytes[i]);
+    }
+
+    if (bursting)
+        this->burst(FALSE);
+    return success;
+}
+
+BOOL EmbeddedController::burst(BOOL enable)
+{
+    if (enable)
+    {
+        if (!this->burstMode || this->burstFailures >= this->retry || !this->status(EC_IBF))
+            return FALSE;
+
+        this->driver.writeIoPortByte(this->scPort, BE_EC); // Write burst enable command to the Status/Command port
+        if (this->status(EC_OBF) &&                        // Wait until OBF is full
+            this->driver.readIoPortByte(this->dataPort) == EC_BAK)
+        {
+            this->burstFailures = 0;
+            return TRUE;
+        }
+
+        // EC may acknowledge late and stay in burst mode, leaving it explicitly
+        this->burstFailures++;
+        this->burst(FALSE);
+        return FALSE;
+    }
+
+    BOOL success = FALSE;
+    if (this->status(EC_IBF))
+    {
+        this->driver.writeIoPortByte(this->scPort, BD_EC); // Write burst disable command to the Status/Command port
+        success = this->status(EC_IBF);                    // Wait until IBF is free
+    }
+
+    // Discarding a late burst acknowledge, otherwise it would be taken as the next read value
+    if (this->driver.readIoPortByte(this->scPort) & EC_OBF)
+        this->driver.readIoPortByte(this->dataPort);
+
+    return success && !(this->driver.readIoPortByte(this->scPort) & EC_BST);
+}
+
 BOOL EmbeddedController::operation(BYTE mode, BYTE bRegister, BYTE *value)
 {
+    Lock lock(this, threadPriority);
     BOOL isRead = mode == READ;
     BYTE operationType = isRead ? RD_EC : WR_EC;
+    if (!isRead)
+        this->cached.reset(bRegister);
 
     for (UINT16 i = 0; i < this->retry; i++)
         if (this->status(EC_IBF)) // Wait until IBF is free
@@ -204,6 +587,11 @@ BOOL EmbeddedController::operation(BYTE mode, BYTE bRegister, BYTE *value)
     return FALSE;
 }
 
+BOOL EmbeddedController::inBurst()
+{
+    return (this->driver.readIoPortByte(this->scPort) & EC_BST) != 0;
+}
+
 BOOL EmbeddedController::status(BYTE flag)
 {
     BOOL done = flag == EC_OBF ? 0x01 : 0x00;
@@ -218,3 +606,98 @@ BOOL EmbeddedController::status(BYTE flag)
 
     return FALSE;
 }
+
+VOID EmbeddedController::setPriority(BYTE priority)
+{
+    threadPriority = std::min(priority, EC_BULK);
+}
+
+EC_LANE_STATS EmbeddedController::laneStats(BYTE priority)
+{
+    std::lock_guard<std::mutex> lock(this->laneMutex);
+    return this->lanes[std::min(priority, EC_BULK)];
+}
+
+VOID EmbeddedController::resetLaneStats()
+{
+    std::lock_guard<std::mutex> lock(this->laneMutex);
+    this->lanes.fill(EC_LANE_STATS());
+}
+
+VOID EmbeddedController::acquire(BYTE priority)
+{
+    std::unique_lock<std::mutex> lock(this->laneMutex);
+    if (this->depth > 0 && this->owner == std::this_thread::get_id())
+    {
+        this->depth++;
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    this->waiting[priority]++;
+    this->laneCondition.wait(lock, [&]() { return this->depth == 0 && !this->preempted(priority); });
+    this->waiting[priority]--;
+    this->owner = std::this_thread::get_id();
+    this->ownerLane = priority;
+    this->depth = 1;
+
+    ULONGLONG delay = std::chrono::duration_cast<std::chrono::microseconds>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+    EC_LANE_STATS &stats = this->lanes[priority];
+    stats.requests++;
+    stats.totalDelay += delay;
+    stats.maxDelay = std::max(stats.maxDelay, delay);
+}
+
+VOID EmbeddedController::release()
+{
+    std::lock_guard<std::mutex> lock(this->laneMutex);
+    if (--this->depth == 0)
+    {
+        this->owner = std::thread::id();
+        this->laneCondition.notify_all();
+    }
+}
+
+BOOL EmbeddedController::yield()
+{
+    std::unique_lock<std::mutex> lock(this->laneMutex);
+    BYTE priority = this->ownerLane;
+    if (!this->preempted(priority))
+        return FALSE;
+
+    // Handing over the EC entirely, even when acquired several times by this thread
+    UINT32 depth = this->depth;
+    this->depth = 0;
+    this->owner = std::thread::id();
+    this->lanes[priority].preemptions++;
+    this->laneCondition.notify_all();
+
+    this->waiting[priority]++;
+    this->laneCondition.wait(lock, [&]() { return this->depth == 0 && !this->preempted(priority); });
+    this->waiting[priority]--;
+    this->owner = std::this_thread::get_id();
+    this->ownerLane = priority;
+    this->depth = depth;
+    return TRUE;
+}
+
+BOOL EmbeddedController::preempted(BYTE priority)
+{
+    for (BYTE lane = EC_CRITICAL; lane < priority; lane++)
+        if (this->waiting[lane] > 0)
+            return TRUE;
+    return FALSE;
+}
+
+EmbeddedController::Lock::Lock(EmbeddedController *ec, BYTE priority)
+{
+    this->ec = ec;
+    this->ec->acquire(priority);
+}
+
+EmbeddedController::Lock::~Lock()
+{
+    this->ec->release();
+}
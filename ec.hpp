@@ -2,6 +2,12 @@
 #define EC_H
 
 #include "map"
+#include "array"
+#include "mutex"
+#include "thread"
+#include "condition_variable"
+#include "bitset"
+#include "vector"
 
 #include "driver.hpp"
 
@@ -15,12 +21,77 @@ constexpr BYTE WRITE = 1;
 
 constexpr BYTE EC_OBF = 0x01;  // Output Buffer Full
 constexpr BYTE EC_IBF = 0x02;  // Input Buffer Full
+constexpr BYTE EC_BST = 0x10;  // Burst Mode Flag
 constexpr BYTE EC_DATA = 0x62; // Data Port
 constexpr BYTE EC_SC = 0x66;   // Status/Command Port
 constexpr BYTE RD_EC = 0x80;   // Read Embedded Controller
 constexpr BYTE WR_EC = 0x81;   // Write Embedded Controller
+constexpr BYTE BE_EC = 0x82;   // Burst Enable Embedded Controller
+constexpr BYTE BD_EC = 0x83;   // Burst Disable Embedded Controller
+constexpr BYTE EC_BAK = 0x90;  // Burst Acknowledge Byte
 
 typedef std::map<BYTE, BYTE> EC_DUMP;
+typedef std::bitset<256> EC_MASK;
+
+// Priority Class
+constexpr BYTE EC_CRITICAL = 0;    // Latency critical control writes, e.g. fan or throttle
+constexpr BYTE EC_INTERACTIVE = 1; // Single register operations by default
+constexpr BYTE EC_BULK = 2;        // Dumps and restores, preempted between byte transactions
+
+/** Queueing delay of a priority class */
+struct EC_LANE_STATS
+{
+    ULONGLONG requests = 0;    // Number of acquired EC accesses
+    ULONGLONG preemptions = 0; // Number of times higher priority requests jumped in
+    ULONGLONG totalDelay = 0;  // Sum of waiting time before access in microseconds
+    ULONGLONG maxDelay = 0;    // Longest waiting time before access in microseconds
+};
+
+// Register Class
+constexpr BYTE EC_STATIC = 0;   // Never changes
+constexpr BYTE EC_COUNTER = 1;  // Changes monotonically
+constexpr BYTE EC_SLOW = 2;     // Changes in less than half of samples
+constexpr BYTE EC_FAST = 3;     // Changes in most of samples
+constexpr BYTE EC_BITFIELD = 4; // Flips a few bits back and forth between a few values
+constexpr BYTE EC_UNKNOWN = 5;  // Never read successfully twice in a row
+constexpr const char *EC_REGISTER_CLASSES[] = {"static", "counter", "slow", "fast", "bitfield", "unknown"};
+
+/** Volatility profile of a register */
+struct EC_REGISTER_PROFILE
+{
+    BYTE type = EC_UNKNOWN;
+    double changeRate = 0;     // Changes per second
+    BYTE activeMask = 0x00;    // Bits which changed at least once
+    UINT32 pollInterval = 0;   // Suggested polling interval in milliseconds
+    UINT32 cacheLifetime = 0;  // Duration in milliseconds which a read value can be reused
+};
+
+typedef std::array<EC_REGISTER_PROFILE, 256> EC_PROFILE;
+
+/** Counters of consistent multi-byte reads */
+struct EC_STATS
+{
+    ULONGLONG consistentReads = 0; // Multi-byte values read in consistent-read mode
+    ULONGLONG burstReads = 0;      // Consistent values read inside a burst window
+    ULONGLONG tornReads = 0;       // Re-reads which didn't match the previous read
+    ULONGLONG unstableReads = 0;   // Consistent reads failed as a value didn't settle within retry limit
+};
+
+/** Contiguous snapshot of all registers */
+struct EC_SNAPSHOT
+{
+    std::array<BYTE, 256> data = {}; // Value of registers
+    EC_MASK valid;                   // Registers which were read successfully
+    ULONGLONG timestamp = 0;         // Capture time in milliseconds since Unix epoch
+
+    EC_SNAPSHOT() = default;
+
+    /** @param dump Map of register's address and value, as generated by older versions. */
+    explicit EC_SNAPSHOT(const EC_DUMP &dump);
+
+    /** @return Map of all register's address and value, 0x00 for registers which couldn't be read. */
+    EC_DUMP toMap() const;
+};
 
 /**
  * Implementation of ACPI embedded controller specification to access the EC's RAM
@@ -34,6 +105,11 @@ public:
     BYTE endianness;
     BOOL driverLoaded = FALSE;
     BOOL driverFileExist = FALSE;
+    BOOL burstMode = TRUE;
+    BOOL consistentRead = FALSE;
+    EC_MASK highByteFirst;
+    EC_STATS stats;
+    EC_PROFILE profile;
 
     /**
      * @param scPort Embedded Controller Status/Command port.
@@ -58,15 +134,88 @@ public:
      */
     EC_DUMP dump();
 
+    /**
+     * Generate a dump of all registers into the given snapshot without allocating.
+     * @param snapshot Snapshot to be filled.
+     * @return Whether all registers were read successfully.
+     */
+    BOOL dump(EC_SNAPSHOT &snapshot);
+
     /** Print generated dump of all registers */
     VOID printDump();
 
+    /**
+     * Print the given snapshot of all registers.
+     * @param snapshot Previously generated snapshot.
+     */
+    VOID printDump(const EC_SNAPSHOT &snapshot);
+
     /**
      * Store generated dump of all registers to the disk.
      * @param output Path of output file.
      */
     VOID saveDump(std::string output = "dump.bin");
 
+    /**
+     * Store the given snapshot of all registers to the disk.
+     * A bitmap of valid registers follows the registers when some of them couldn't be read.
+     * @param snapshot Previously generated snapshot.
+     * @param output Path of output file.
+     */
+    VOID saveDump(const EC_SNAPSHOT &snapshot, std::string output = "dump.bin");
+
+    /**
+     * Load stored dump of all registers from the disk.
+     * @param input Path of input file.
+     * @return Snapshot of registers, empty if the file couldn't be read.
+     */
+    EC_SNAPSHOT loadDump(std::string input = "dump.bin");
+
+    /**
+     * Restore registers to the given snapshot by writing only the differing ones.
+     * Registers are written in ascending order and verified afterwards. Once a higher priority
+     * request jumped in, each register is re-read and skipped if it no longer holds the planned value.
+     * @param snapshot Previously generated snapshot, only valid registers are restored.
+     * @param mask Registers allowed to be written, read-only and volatile ones should be left out.
+     * @param dryRun Only print the planned writes.
+     * @return Address of registers which didn't hold the restored value.
+     */
+    std::vector<BYTE> restoreDump(const EC_SNAPSHOT &snapshot, EC_MASK mask, BOOL dryRun = FALSE);
+
+    /**
+     * Restore registers to the given dump by writing only the differing ones.
+     * @param snapshot Previously generated dump.
+     * @param mask Registers allowed to be written, read-only and volatile ones should be left out.
+     * @param dryRun Only print the planned writes.
+     * @return Address of registers which didn't hold the restored value.
+     */
+    std::vector<BYTE> restoreDump(const EC_DUMP &snapshot, EC_MASK mask, BOOL dryRun = FALSE);
+
+    /**
+     * Load volatility profile of registers generated by `RegisterProfiler`.
+     * `readByte()` reuses the value of registers within their cache lifetime.
+     * @param input Path of input file.
+     * @return Successfulness of operation.
+     */
+    BOOL loadProfile(std::string input = "profile.csv");
+
+    /**
+     * Set priority class of EC accesses made by the calling thread, on all instances.
+     * Dumps and restores always run as `EC_BULK`.
+     * @param priority Priority class, could be `EC_CRITICAL`, `EC_INTERACTIVE` or `EC_BULK`.
+     */
+    static VOID setPriority(BYTE priority);
+
+    /**
+     * Get queueing delay of a priority class.
+     * @param priority Priority class.
+     * @return Counters of the priority class.
+     */
+    EC_LANE_STATS laneStats(BYTE priority);
+
+    /** Reset queueing delay counters of all priority classes */
+    VOID resetLaneStats();
+
     /**
      * Read EC register as BYTE.
      * @param bRegister Address of register.
@@ -89,6 +238,16 @@ public:
      */
     DWORD readDword(BYTE bRegister);
 
+    /**
+     * Read consecutive EC registers.
+     * @param bRegister Address of first register.
+     * @param buffer Buffer to be filled with value of registers.
+     * @param length Number of registers.
+     * @param stride Size of each value in bytes, values are read consistently on their own.
+     * @return Successfulness of operation.
+     */
+    BOOL readBuffer(BYTE bRegister, BYTE *buffer, UINT16 length, UINT16 stride = 1);
+
     /**
      * Write EC register as BYTE.
      * @param bRegister Address of register.
@@ -113,10 +272,61 @@ public:
      */
     BOOL writeDword(BYTE bRegister, DWORD value);
 
+    /**
+     * Atomically update bits of EC register as BYTE.
+     * Register is read and written in a single locked sequence, inside a burst window
+     * when the EC supports it, and the write is skipped if masked bits already match.
+     * @param bRegister Address of register.
+     * @param mask Bits to be modified.
+     * @param value New value of masked bits.
+     * @param old Value of register before the update, filled whenever it could be read.
+     * @return Successfulness of operation, registers are left untouched on failure.
+     */
+    BOOL updateBits(BYTE bRegister, BYTE mask, BYTE value, BYTE *old = NULL);
+
+    /**
+     * Atomically update bits of EC register as WORD.
+     * @param bRegister Address of register.
+     * @param mask Bits to be modified.
+     * @param value New value of masked bits.
+     * @param old Value of register before the update, filled whenever it could be read.
+     * @return Successfulness of operation, registers are left untouched on failure.
+     */
+    BOOL updateWordBits(BYTE bRegister, WORD mask, WORD value, WORD *old = NULL);
+
+    /**
+     * Atomically update bits of EC register as DWORD.
+     * @param bRegister Address of register.
+     * @param mask Bits to be modified.
+     * @param value New value of masked bits.
+     * @param old Value of register before the update, filled whenever it could be read.
+     * @return Successfulness of operation, registers are left untouched on failure.
+     */
+    BOOL updateDwordBits(BYTE bRegister, DWORD mask, DWORD value, DWORD *old = NULL);
+
 protected:
     UINT16 retry;
     UINT16 timeout;
     Driver driver;
+    UINT16 burstFailures = 0;
+    std::mutex laneMutex;
+    std::condition_variable laneCondition;
+    std::thread::id owner;
+    UINT32 depth = 0;
+    BYTE ownerLane = EC_INTERACTIVE;
+    std::array<UINT32, 3> waiting = {};
+    std::array<EC_LANE_STATS, 3> lanes;
+    EC_MASK cached;
+    std::array<BYTE, 256> cache = {};
+    std::array<ULONGLONG, 256> cachedAt = {};
+
+    /**
+     * Generate a dump of all registers into the given snapshot.
+     * @param snapshot Snapshot to be filled.
+     * @param preempted Set when higher priority requests accessed the EC during the dump.
+     * @return Whether all registers were read successfully.
+     */
+    BOOL dump(EC_SNAPSHOT &snapshot, BOOL *preempted);
 
     /**
      * Perform a read or write operation.
@@ -127,12 +337,82 @@ protected:
      */
     BOOL operation(BYTE mode, BYTE bRegister, BYTE *value);
 
+    /**
+     * Read consecutive values, consistently when `consistentRead` is enabled.
+     * Each value is read inside its own burst window when the EC supports it, otherwise
+     * it's re-read until two passes match or retries run out. Higher priority requests
+     * may access the EC between values.
+     * @param bRegister Address of first register.
+     * @param bytes Buffer to be filled with value of registers.
+     * @param length Number of registers, a multiple of `stride`.
+     * @param stride Size of each value in bytes.
+     * @return Successfulness of operation, `FALSE` if a value didn't settle.
+     */
+    BOOL read(BYTE bRegister, BYTE *bytes, UINT16 length, UINT16 stride);
+
+    /**
+     * Read-modify-write consecutive registers in a single locked sequence.
+     * @param bRegister Address of first register.
+     * @param size Number of registers, up to 4.
+     * @param mask Bits to be modified.
+     * @param value New value of masked bits.
+     * @param old Value of registers before the update, filled whenever they could be read.
+     * @return Successfulness of operation, already written registers are rolled back on failure.
+     */
+    BOOL update(BYTE bRegister, BYTE size, DWORD mask, DWORD value, DWORD *old);
+
+    /**
+     * Enter or leave EC's burst mode, caller must hold the lock.
+     * Burst mode isn't requested anymore after `retry` consecutive unacknowledged attempts.
+     * @param enable Whether to enable or disable burst mode.
+     * @return Whether EC entered or left the burst mode.
+     */
+    BOOL burst(BOOL enable);
+
+    /**
+     * Check whether the EC is still in burst mode, it may leave on its own, e.g. on a host timeout.
+     * @return Whether burst mode flag is set.
+     */
+    BOOL inBurst();
+
     /**
      * Check EC status for permission to read or write.
      * @param flag Type of flag.
      * @return Whether allowed to perform read or write.
      */
     BOOL status(BYTE flag);
+
+    /**
+     * Wait for exclusive access to the EC, reentrant for the owner thread.
+     * Access is granted once no request of a higher priority class is waiting.
+     * @param priority Priority class of the request.
+     */
+    VOID acquire(BYTE priority);
+
+    /** Give up exclusive access to the EC */
+    VOID release();
+
+    /**
+     * Let waiting requests of a higher priority class access the EC and resume afterwards.
+     * Must be called between byte transactions outside of a burst window.
+     * @return Whether other requests accessed the EC meanwhile.
+     */
+    BOOL yield();
+
+    /**
+     * Check whether requests of a higher priority class are waiting, caller must hold `laneMutex`.
+     * @param priority Priority class to compare with.
+     * @return Whether a higher priority request is waiting.
+     */
+    BOOL preempted(BYTE priority);
+
+    /** Scoped exclusive access to the EC */
+    struct Lock
+    {
+        EmbeddedController *ec;
+        Lock(EmbeddedController *ec, BYTE priority);
+        ~Lock();
+    };
 };
 
 #endif
@@ -0,0 +1,241 @@
+#include <set>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <windows.h>
+#include <sddl.h>
+
+#include "ec.hpp"
+#include "ipc.hpp"
+#include "helper.hpp"
+
+ECHelper::ECHelper(EmbeddedController &ec, EC_MASK writable, std::string pipeName) : ec(ec)
+{
+    this->writable = writable;
+    this->pipeName = pipeName;
+}
+
+BOOL ECHelper::serve()
+{
+    // Full access for SYSTEM and administrators, read and write for authenticated
+    // local users without the right to create rogue instances of the pipe
+    SECURITY_ATTRIBUTES attributes = {sizeof(SECURITY_ATTRIBUTES), NULL, FALSE};
+    if (!ConvertStringSecurityDescriptorToSecurityDescriptorA(
+            "D:(A;;GA;;;SY)(A;;GA;;;BA)(A;;0x12019b;;;AU)",
+            SDDL_REVISION_1,
+            &attributes.lpSecurityDescriptor,
+            NULL))
+        return FALSE;
+
+    BOOL success = TRUE;
+    UINT16 failures = 0;
+    DWORD openMode = PIPE_ACCESS_DUPLEX | FILE_FLAG_FIRST_PIPE_INSTANCE;
+    this->running = TRUE;
+    while (this->running)
+    {
+        // A new instance waits for the next client while connected ones are served
+        HANDLE pipe = CreateNamedPipeA(
+            this->pipeName.c_str(),
+            openMode,
+            PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+            PIPE_UNLIMITED_INSTANCES,
+            IPC_BUFFER_SIZE,
+            IPC_BUFFER_SIZE,
+            0,
+            &attributes);
+        if (pipe == INVALID_HANDLE_VALUE)
+        {
+            // Backing off on transient failures, e.g. resource exhaustion, as connected clients are still served
+            if ((openMode & FILE_FLAG_FIRST_PIPE_INSTANCE) || failures >= IPC_SERVE_RETRY)
+            {
+                success = FALSE;
+                break;
+            }
+            Sleep(100 << failures++);
+            continue;
+        }
+        openMode &= ~FILE_FLAG_FIRST_PIPE_INSTANCE;
+        failures = 0;
+
+        if (!ConnectNamedPipe(pipe, NULL) && GetLastError() != ERROR_PIPE_CONNECTED)
+        {
+            success = !this->running;
+            CloseHandle(pipe);
+            break;
+        }
+        if (!this->running)
+        {
+            CloseHandle(pipe);
+            break;
+        }
+
+        std::lock_guard<std::mutex> lock(this->sessionMutex);
+        this->sessions.insert(pipe);
+        std::thread(&ECHelper::session, this, pipe).detach();
+    }
+    this->running = FALSE;
+    LocalFree(attributes.lpSecurityDescriptor);
+
+    // Waking up sessions blocked on reading their client until all of them are closed
+    std::unique_lock<std::mutex> lock(this->sessionMutex);
+    while (!this->sessionCondition.wait_for(lock, std::chrono::milliseconds(100), [this] { return this->sessions.empty(); }))
+        for (HANDLE pipe : this->sessions)
+            CancelIoEx(pipe, NULL);
+
+    return success;
+}
+
+VOID ECHelper::stop()
+{
+    this->running = FALSE;
+
+    // Waking up the pending connection wait
+    HANDLE pipe = CreateFileA(this->pipeName.c_str(), GENERIC_READ, 0, NULL, OPEN_EXISTING, 0, NULL);
+    if (pipe != INVALID_HANDLE_VALUE)
+        CloseHandle(pipe);
+}
+
+VOID ECHelper::session(HANDLE pipe)
+{
+    std::vector<BYTE> request(IPC_BUFFER_SIZE);
+    std::vector<BYTE> response(IPC_BUFFER_SIZE);
+    while (this->running)
+    {
+        DWORD size = 0;
+        if (!ReadFile(pipe, request.data(), IPC_BUFFER_SIZE, &size, NULL))
+        {
+            if (GetLastError() != ERROR_MORE_DATA) // Client disconnected or serving stopped
+                break;
+
+            // Discarding rest of the oversized message, answered as malformed
+            while (!ReadFile(pipe, request.data(), IPC_BUFFER_SIZE, &size, NULL) &&
+                   GetLastError() == ERROR_MORE_DATA)
+                ;
+            size = 0;
+        }
+
+        DWORD written = 0;
+        DWORD length = this->execute(request.data(), size, response.data());
+        if (!WriteFile(pipe, response.data(), length, &written, NULL))
+            break;
+    }
+
+    DisconnectNamedPipe(pipe);
+    CloseHandle(pipe);
+
+    std::lock_guard<std::mutex> lock(this->sessionMutex);
+    this->sessions.erase(pipe);
+    this->sessionCondition.notify_all();
+}
+
+DWORD ECHelper::execute(const BYTE *request, DWORD size, BYTE *response)
+{
+    UINT16 count = size >= IPC_REQUEST_HEADER_SIZE ? getValue(request, 2) : 0;
+    DWORD length = IPC_RESPONSE_HEADER_SIZE;
+    putValue(response, 0, 2);
+    if (size != IPC_REQUEST_HEADER_SIZE + (DWORD)count * IPC_OPERATION_SIZE)
+        return length;
+
+    EmbeddedController::setPriority(request[2]);
+
+    for (UINT16 i = 0; i < count; i++)
+    {
+        const BYTE *operation = request + IPC_REQUEST_HEADER_SIZE + i * IPC_OPERATION_SIZE;
+        BYTE opcode = operation[0];
+        BYTE bRegister = operation[1];
+        DWORD mask = getValue(operation + 2, 4);
+        DWORD value = getValue(operation + 6, 4);
+        BYTE registers = opcode & 0x0F;
+        BYTE status = IPC_OK;
+        DWORD result = 0x00;
+
+        if (length + IPC_RESULT_SIZE + (opcode == IPC_DUMP ? IPC_SNAPSHOT_SIZE : 0) > IPC_BUFFER_SIZE)
+        {
+            putValue(response, 0, 2);
+            return IPC_RESPONSE_HEADER_SIZE;
+        }
+
+        switch (opcode)
+        {
+        case IPC_READ_BYTE:
+        case IPC_READ_WORD:
+        case IPC_READ_DWORD:
+        {
+            BYTE bytes[4] = {0x00};
+            if (bRegister + registers > 0x100)
+                status = IPC_INVALID;
+            else if (!this->ec.readBuffer(bRegister, bytes, registers, registers))
+                status = IPC_FAILED;
+            for (BYTE j = 0; j < registers; j++)
+                result |= (DWORD)bytes[j] << ((this->ec.endianness == BIG_ENDIAN ? registers - 1 - j : j) * 8);
+            break;
+        }
+        case IPC_WRITE_BYTE:
+        case IPC_WRITE_WORD:
+        case IPC_WRITE_DWORD:
+            if (bRegister + registers > 0x100)
+                status = IPC_INVALID;
+            else if (!this->allowed(bRegister, registers))
+                status = IPC_DENIED;
+            else if (!(registers == 1   ? this->ec.writeByte(bRegister, value)
+                       : registers == 2 ? this->ec.writeWord(bRegister, value)
+                                        : this->ec.writeDword(bRegister, value)))
+                status = IPC_FAILED;
+            break;
+        case IPC_UPDATE_BYTE:
+        case IPC_UPDATE_WORD:
+        case IPC_UPDATE_DWORD:
+            if (bRegister + registers > 0x100)
+                status = IPC_INVALID;
+            else if (!this->allowed(bRegister, registers))
+                status = IPC_DENIED;
+            else
+            {
+                BYTE oldByte = 0x00;
+                WORD oldWord = 0x00;
+                BOOL success = registers == 1   ? this->ec.updateBits(bRegister, mask, value, &oldByte)
+                               : registers == 2 ? this->ec.updateWordBits(bRegister, mask, value, &oldWord)
+                                                : this->ec.updateDwordBits(bRegister, mask, value, &result);
+                if (registers == 1)
+                    result = oldByte;
+                else if (registers == 2)
+                    result = oldWord;
+                if (!success)
+                    status = IPC_FAILED;
+            }
+            break;
+        case IPC_DUMP:
+        {
+            EC_SNAPSHOT snapshot;
+            if (!this->ec.dump(snapshot))
+                status = IPC_FAILED;
+
+            BYTE *cursor = response + length + IPC_RESULT_SIZE;
+            putValue(cursor, snapshot.timestamp, 8);
+            for (UINT16 j = 0; j < 32; j++)
+                putValue(cursor + 8 + j, (snapshot.valid >> (j * 8) & EC_MASK(0xFF)).to_ulong(), 1);
+            std::copy(snapshot.data.begin(), snapshot.data.end(), cursor + 40);
+            break;
+        }
+        default:
+            status = IPC_INVALID;
+        }
+
+        response[length] = status;
+        putValue(response + length + 1, result, 4);
+        length += IPC_RESULT_SIZE + (opcode == IPC_DUMP ? IPC_SNAPSHOT_SIZE : 0);
+    }
+
+    putValue(response, count, 2);
+    return length;
+}
+
+BOOL ECHelper::allowed(BYTE bRegister, BYTE size)
+{
+    for (BYTE i = 0; i < size; i++)
+        if (!this->writable.test(bRegister + i))
+            return FALSE;
+    return TRUE;
+}
@@ -0,0 +1,70 @@
+#ifndef HELPER_H
+#define HELPER_H
+
+#include "set"
+#include "mutex"
+#include "atomic"
+#include "string"
+#include "condition_variable"
+
+#include "ec.hpp"
+#include "ipc.hpp"
+
+/**
+ * Privileged process side of the EC access, serving batches of operations
+ * from unprivileged `ECClient` instances over a local named pipe.
+ */
+class ECHelper
+{
+public:
+    EC_MASK writable;
+
+    /**
+     * @param ec Embedded controller owned by the helper.
+     * @param writable Allow-list of registers which clients can write.
+     * @param pipeName Name of the pipe to listen on.
+     */
+    ECHelper(EmbeddedController &ec, EC_MASK writable = EC_MASK(), std::string pipeName = IPC_PIPE_NAME);
+
+    /**
+     * Serve clients until `stop()` is called, each connected client on its own thread.
+     * @return `FALSE` if serving ended early as a pipe instance couldn't be created or connected.
+     */
+    BOOL serve();
+
+    /** Stop serving and disconnect all clients */
+    VOID stop();
+
+    /**
+     * Execute a batch of operations, in its priority class for the rest of the calling thread.
+     * @param request Encoded request message.
+     * @param size Size of request message.
+     * @param response Buffer of `IPC_BUFFER_SIZE` bytes for the response message.
+     * @return Size of response message.
+     */
+    DWORD execute(const BYTE *request, DWORD size, BYTE *response);
+
+protected:
+    EmbeddedController &ec;
+    std::string pipeName;
+    std::atomic<BOOL> running = FALSE;
+    std::mutex sessionMutex;
+    std::condition_variable sessionCondition;
+    std::set<HANDLE> sessions; // Pipe instances with a connected client
+
+    /**
+     * Serve a connected client until it disconnects or serving stops.
+     * @param pipe Pipe instance connected to the client.
+     */
+    VOID session(HANDLE pipe);
+
+    /**
+     * Check whether all registers of a write operation are allowed.
+     * @param bRegister Address of first register.
+     * @param size Number of registers.
+     * @return Whether the write is allowed.
+     */
+    BOOL allowed(BYTE bRegister, BYTE size);
+};
+
+#endif
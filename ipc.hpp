@@ -0,0 +1,82 @@
+#ifndef IPC_H
+#define IPC_H
+
+/**
+ * Binary protocol between `ECHelper` and `ECClient`, all values are little endian.
+ * Each pipe message carries a whole batch of operations, executed in the given priority class:
+ *   Request:  [UINT16 count][BYTE priority] followed by `count` operations of
+ *             [BYTE opcode][BYTE register][DWORD mask][DWORD value]
+ *   Response: [UINT16 count] followed by `count` results of
+ *             [BYTE status][DWORD value], dump results are followed by
+ *             [ULONGLONG timestamp][32 bytes of valid registers bitmap][256 bytes of registers]
+ * A response with zero `count` means the request was malformed or too large.
+ */
+
+auto constexpr IPC_PIPE_NAME = "\\\\.\\pipe\\EmbeddedController";
+constexpr DWORD IPC_BUFFER_SIZE = 0x10000; // Maximum size of a message
+constexpr BYTE IPC_REQUEST_HEADER_SIZE = 3;
+constexpr BYTE IPC_RESPONSE_HEADER_SIZE = 2;
+constexpr BYTE IPC_OPERATION_SIZE = 10;
+constexpr BYTE IPC_RESULT_SIZE = 5;
+constexpr UINT16 IPC_SNAPSHOT_SIZE = 8 + 32 + 256;
+constexpr BYTE IPC_SERVE_RETRY = 5; // Attempts to create a pipe instance before `ECHelper::serve()` fails
+
+// Opcodes, low nibble holds the number of registers
+constexpr BYTE IPC_READ_BYTE = 0x11;
+constexpr BYTE IPC_READ_WORD = 0x12;
+constexpr BYTE IPC_READ_DWORD = 0x14;
+constexpr BYTE IPC_WRITE_BYTE = 0x21;
+constexpr BYTE IPC_WRITE_WORD = 0x22;
+constexpr BYTE IPC_WRITE_DWORD = 0x24;
+constexpr BYTE IPC_UPDATE_BYTE = 0x31;
+constexpr BYTE IPC_UPDATE_WORD = 0x32;
+constexpr BYTE IPC_UPDATE_DWORD = 0x34;
+constexpr BYTE IPC_DUMP = 0x40;
+
+// Status Code
+constexpr BYTE IPC_OK = 0;
+constexpr BYTE IPC_FAILED = 1;  // EC didn't respond
+constexpr BYTE IPC_DENIED = 2;  // Register isn't in the allow-list of writable registers
+constexpr BYTE IPC_INVALID = 3; // Unknown opcode or out of range registers
+
+struct IPC_OPERATION
+{
+    BYTE opcode;
+    BYTE bRegister;
+    DWORD mask;
+    DWORD value;
+};
+
+struct IPC_RESULT
+{
+    BYTE status;
+    DWORD value;
+};
+
+/**
+ * Decode a little endian value of the message.
+ * @param buffer Position of value in the message.
+ * @param size Size of value in bytes, up to 4.
+ * @return Decoded value.
+ */
+inline DWORD getValue(const BYTE *buffer, BYTE size)
+{
+    DWORD value = 0x00;
+    for (BYTE i = 0; i < size; i++)
+        value |= (DWORD)buffer[i] << (i * 8);
+    return value;
+}
+
+/**
+ * Encode a value into the message in little endian.
+ * @param buffer Position of value in the message.
+ * @param value Value to be encoded.
+ * @param size Size of value in bytes, up to 8.
+ */
+inline VOID putValue(BYTE *buffer, ULONGLONG value, BYTE size)
+{
+    for (BYTE i = 0; i < size; i++)
+        buffer[i] = (value >> (i * 8)) & 0xFF;
+}
+
+#endif
@@ -0,0 +1,167 @@
+#include <bitset>
+#include <string>
+#include <cstdio>
+#include <fstream>
+#include <algorithm>
+#include <windows.h>
+
+#include "ec.hpp"
+#include "profiler.hpp"
+
+RegisterProfiler::RegisterProfiler(EmbeddedController &ec) : ec(ec)
+{
+}
+
+VOID RegisterProfiler::run(UINT32 window, UINT32 interval)
+{
+    EC_SNAPSHOT snapshot;
+    ULONGLONG start = GetTickCount64();
+    do
+    {
+        this->ec.dump(snapshot);
+        this->sample(snapshot);
+        Sleep(interval);
+    } while (GetTickCount64() - start < window);
+
+    this->classify();
+}
+
+VOID RegisterProfiler::sample(const EC_SNAPSHOT &snapshot)
+{
+    if (this->samples == 0)
+        this->firstTimestamp = snapshot.timestamp;
+
+    for (UINT16 address = 0x00; address <= 0xFF; address++)
+    {
+        if (!snapshot.valid.test(address))
+            continue;
+
+        BYTE value = snapshot.data[address];
+        this->values[address].set(value);
+        if (this->samples == 0 || !this->previous.valid.test(address))
+            continue;
+
+        BYTE last = this->previous.data[address];
+        BYTE delta = value - last; // Wrapping around for counters
+        this->observations[address]++;
+        if (delta != 0)
+        {
+            this->changes[address]++;
+            this->activeMask[address] |= value ^ last;
+            if (((value ^ last) & ((value ^ last) - 1)) == 0)
+                this->flips[address]++;
+            if (delta < 0x80)
+                this->increments[address]++;
+            else if (delta > 0x80) // Half way around is a toggle of the top bit, not a direction
+                this->decrements[address]++;
+        }
+    }
+
+    this->previous = snapshot;
+    this->lastTimestamp = snapshot.timestamp;
+    this->samples++;
+}
+
+VOID RegisterProfiler::classify()
+{
+    double duration = (this->lastTimestamp - this->firstTimestamp) / 1000.0;
+    UINT32 interval = this->samples > 1
+                          ? (UINT32)((this->lastTimestamp - this->firstTimestamp) / (this->samples - 1))
+                          : 0;
+
+    for (UINT16 address = 0x00; address <= 0xFF; address++)
+    {
+        EC_REGISTER_PROFILE &entry = this->profile[address];
+        UINT32 changes = this->changes[address];
+        size_t distinct = this->values[address].count();
+        entry = EC_REGISTER_PROFILE();
+        entry.activeMask = this->activeMask[address];
+        entry.changeRate = duration > 0 ? changes / duration : 0;
+
+        if (this->observations[address] == 0) // Never read successfully twice in a row
+            entry.type = EC_UNKNOWN;
+        else if (changes == 0)
+            entry.type = EC_STATIC;
+        else
+        {
+            // Values spanning a contiguous range are measurements, e.g. temperature
+            UINT16 lowest = 0x00;
+            UINT16 highest = 0xFF;
+            while (!this->values[address].test(lowest))
+                lowest++;
+            while (!this->values[address].test(highest))
+                highest--;
+            BOOL contiguous = highest - lowest + 1U == distinct;
+            size_t bits = std::bitset<8>(entry.activeMask).count();
+
+            // Flags flip a few bits one at a time, whatever their numeric order
+            if (distinct <= 4 && (!contiguous || (bits <= 2 && this->flips[address] == changes)))
+                entry.type = EC_BITFIELD;
+            else if (this->increments[address] == changes || this->decrements[address] == changes)
+                entry.type = EC_COUNTER;
+            else if (changes * 2 >= this->observations[address])
+                entry.type = EC_FAST;
+            else
+                entry.type = EC_SLOW;
+        }
+
+        // Polling twice per expected change, never faster than the sampling interval
+        UINT32 period = entry.changeRate > 0 ? (UINT32)(1000 / entry.changeRate) : 0;
+        switch (entry.type)
+        {
+        case EC_STATIC:
+            // Unchanged within the window doesn't mean constant, caching no longer than it was sampled
+            entry.pollInterval = std::max<UINT32>(60000, duration * 1000);
+            entry.cacheLifetime = interval;
+            break;
+        case EC_COUNTER:
+        case EC_SLOW:
+            entry.pollInterval = std::max(interval, period / 2);
+            entry.cacheLifetime = entry.pollInterval / 2;
+            break;
+        default:
+            entry.pollInterval = interval;
+            entry.cacheLifetime = 0;
+        }
+    }
+}
+
+VOID RegisterProfiler::reset()
+{
+    this->samples = 0;
+    this->firstTimestamp = 0;
+    this->lastTimestamp = 0;
+    this->observations.fill(0);
+    this->changes.fill(0);
+    this->increments.fill(0);
+    this->decrements.fill(0);
+    this->flips.fill(0);
+    this->activeMask.fill(0x00);
+    for (auto &value : this->values)
+        value.reset();
+}
+
+BOOL RegisterProfiler::saveProfile(std::string output)
+{
+    std::ofstream file(output, std::ios::out);
+    if (!file)
+        return FALSE;
+
+    char line[64];
+    file << "register,class,rate,mask,poll,cache" << std::endl;
+    for (UINT16 address = 0x00; address <= 0xFF; address++)
+    {
+        const EC_REGISTER_PROFILE &entry = this->profile[address];
+        std::snprintf(line, sizeof(line), "0x%02X,%s,%.3f,0x%02X,%u,%u\n",
+                      address,
+                      EC_REGISTER_CLASSES[entry.type],
+                      entry.changeRate,
+                      entry.activeMask,
+                      entry.pollInterval,
+                      entry.cacheLifetime);
+        file << line;
+    }
+
+    file.close();
+    return !file.fail();
+}
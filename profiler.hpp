@@ -0,0 +1,63 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "array"
+#include "bitset"
+#include "string"
+
+#include "ec.hpp"
+
+/**
+ * Volatility profiler of EC's RAM, classifying registers by how they change over
+ * a sampling window and suggesting polling interval and cache lifetime for them.
+ */
+class RegisterProfiler
+{
+public:
+    EC_PROFILE profile;
+
+    /** @param ec Embedded controller to be sampled. */
+    RegisterProfiler(EmbeddedController &ec);
+
+    /**
+     * Sample all registers periodically and classify them.
+     * @param window Duration of sampling in milliseconds.
+     * @param interval Delay between two samples in milliseconds.
+     */
+    VOID run(UINT32 window = 60000, UINT32 interval = 500);
+
+    /**
+     * Add a sample, e.g. from a snapshot archive.
+     * @param snapshot Snapshot of all registers, timestamps must not decrease.
+     */
+    VOID sample(const EC_SNAPSHOT &snapshot);
+
+    /** Classify registers based on samples added so far */
+    VOID classify();
+
+    /** Discard all samples */
+    VOID reset();
+
+    /**
+     * Store the profile to the disk in CSV format, loadable by `EmbeddedController::loadProfile()`.
+     * @param output Path of output file.
+     * @return Successfulness of operation.
+     */
+    BOOL saveProfile(std::string output = "profile.csv");
+
+protected:
+    EmbeddedController &ec;
+    ULONGLONG firstTimestamp = 0;
+    ULONGLONG lastTimestamp = 0;
+    ULONGLONG samples = 0;
+    EC_SNAPSHOT previous;
+    std::array<UINT32, 256> observations = {}; // Pairs of consecutive valid samples
+    std::array<UINT32, 256> changes = {};
+    std::array<UINT32, 256> increments = {};
+    std::array<UINT32, 256> decrements = {};
+    std::array<UINT32, 256> flips = {}; // Changes of a single bit
+    std::array<BYTE, 256> activeMask = {};
+    std::array<std::bitset<256>, 256> values;
+};
+
+#endif